@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+
+#include "mapreduce.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+using namespace std;
+using namespace mapreduce;
+
+// Microbenchmarks for the hot kernels, run on fixed synthetic inputs so results are comparable between runs.
+// Usage: ./bench [repetitions] [kernel set]
+
+#define NR_VOCAB 20000	 // Distinct words in the synthetic text
+#define NR_TOKENS 400000 // Raw tokens in the synthetic text
+#define NR_FILES 64		 // The tokens are spread evenly over this many "files"
+#define NR_LOCALS 4		 // How many mapper-local lists get merged
+#define NR_SLICES 2		 // Every letter is written in this many slices, like a heavy letter split between reducers
+
+// One implementation of every kernel - add another entry to kernelSets to compare it against the baseline
+struct kernels {
+	const char *name;
+	void (*processString)(string &input, string &output);
+	int (*mapWord)(struct wordList *localList, const string &word, int fileId);
+	void (*mergeLists)(struct wordList *localList, struct wordList *masterList);
+	void (*sortWordlists)(vector<wordEntry> &words);
+	void (*bucketLetters)(vector<wordEntry> &sortedWords, vector<wordEntry *> letters[26]);
+	void (*collectSlice)(vector<wordEntry *> &letter, int part, int parts, vector<wordEntry *> &words);
+	void (*writeWords)(ostream &out, vector<wordEntry *> &words);
+};
+
+// The writer from before letters were split into tickets: a separate pass over every word for each letter
+void scanLetters(vector<wordEntry> &sortedWords, vector<wordEntry *> letters[26]) {
+	for (int i = 0; i < 26; i++) {
+		letters[i].clear();
+		for (auto &entry : sortedWords) {
+			if (entry.first[0] == 'a' + i) {
+				letters[i].push_back(&entry);
+			}
+		}
+	}
+}
+
+// ...and a letter was never split, so the first slice gets all of it
+void wholeLetter(vector<wordEntry *> &letter, int part, int parts, vector<wordEntry *> &words) {
+	words.clear();
+	if (part > 0) {
+		return;
+	}
+
+	words = letter;
+	for (auto entry : words) {
+		std::sort(entry->second.begin(), entry->second.end());
+	}
+}
+
+struct kernels kernelSets[] = {
+	{"baseline", processString, mapWord, mergeLists, sortWordlists, scanLetters, wholeLetter, writeWords},
+	{"combiner", processString, combineWord, combineLists, sortWordlists, bucketLetters, collectSlice, writeWords},
+};
+
+struct benchData {
+	vector<string> tokens;		// Raw tokens, as read from a file
+	vector<string> cleanTokens; // The same tokens after processString
+	vector<int> tokenFile;		// Which file every token belongs to
+	unsigned long tokenBytes;
+	unsigned long cleanBytes;
+};
+
+// Keeps the compiler from throwing away results
+volatile unsigned long benchSink;
+
+unsigned long long rngState = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64 - fixed seed so every run sees the same input
+unsigned long long nextRandom() {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 7;
+	rngState ^= rngState << 17;
+	return rngState;
+}
+
+unsigned long long readCycles() {
+#if HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Zipf-distributed words with some capitals and punctuation thrown in, like real text
+void generateData(struct benchData *data) {
+	vector<string> vocab(NR_VOCAB);
+	vector<double> cumulative(NR_VOCAB);
+	double total = 0;
+
+	for (int i = 0; i < NR_VOCAB; i++) {
+		int len = 1 + nextRandom() % 12;
+		for (int j = 0; j < len; j++) {
+			vocab[i] += 'a' + nextRandom() % 26;
+		}
+
+		total += 1.0 / (i + 1);
+		cumulative[i] = total;
+	}
+
+	const char *punctuation = ",.;!?\"'-";
+
+	data->tokenBytes = 0;
+	data->cleanBytes = 0;
+
+	for (int i = 0; i < NR_TOKENS; i++) {
+		double pick = (nextRandom() % 1000000) / 1000000.0 * total;
+		int rank = std::upper_bound(cumulative.begin(), cumulative.end() - 1, pick) - cumulative.begin();
+
+		string token = vocab[rank];
+		if (nextRandom() % 10 == 0) {
+			token[0] = toupper(token[0]);
+		}
+		if (nextRandom() % 7 == 0) {
+			token += punctuation[nextRandom() % strlen(punctuation)];
+		}
+
+		data->tokens.push_back(token);
+		data->cleanTokens.push_back(vocab[rank]);
+		data->tokenFile.push_back(1 + (long)i * NR_FILES / NR_TOKENS);
+
+		data->tokenBytes += token.size();
+		data->cleanBytes += vocab[rank].size();
+	}
+}
+
+// Runs setup (untimed) and then run (timed) reps times, printing median, p99 and cycles/byte
+// run returns how many bytes it went through
+void measure(const char *name, int reps, function<void()> setup, function<unsigned long()> run) {
+	vector<double> times;
+	vector<double> cycles;
+	unsigned long bytes = 0;
+
+	// First run is a warmup and isn't counted
+	for (int i = 0; i <= reps; i++) {
+		setup();
+
+		double start = nowNs();
+		unsigned long long startCycles = readCycles();
+		bytes = run();
+		unsigned long long endCycles = readCycles();
+		double end = nowNs();
+
+		if (i > 0) {
+			times.push_back(end - start);
+			cycles.push_back(endCycles - startCycles);
+		}
+	}
+
+	std::sort(times.begin(), times.end());
+	std::sort(cycles.begin(), cycles.end());
+
+	int p99 = (int)(0.99 * reps + 0.5) - 1;
+	if (p99 < 0) {
+		p99 = 0;
+	}
+
+	printf("%-16s %12lu %12.1f %12.1f", name, bytes, times[reps / 2] / 1000, times[p99] / 1000);
+	if (HAVE_TSC) {
+		printf(" %12.2f\n", cycles[reps / 2] / bytes);
+	} else {
+		printf(" %12.2f\n", times[reps / 2] / bytes); // No cycle counter, ns/byte instead
+	}
+}
+
+unsigned long wordBytes(struct wordList *list) {
+	unsigned long bytes = 0;
+	for (auto &wordInfo : list->list) {
+		bytes += wordInfo.first.size();
+	}
+	return bytes;
+}
+
+void runKernels(struct kernels *k, struct benchData *data, int reps) {
+	printf("\nKernel set: %s (%d repetitions)\n", k->name, reps);
+	printf("%-16s %12s %12s %12s %12s\n", "kernel", "bytes", "median(us)", "p99(us)", HAVE_TSC ? "cycles/byte" : "ns/byte");
+
+	measure("processString", reps, [] {}, [&] {
+		string output;
+		unsigned long total = 0;
+		for (auto &token : data->tokens) {
+			k->processString(token, output);
+			total += output.size();
+		}
+		benchSink = total;
+		return data->tokenBytes;
+	});
+
+	struct wordList *localList = NULL;
+	measure("mapWord", reps, [&] {
+		delete localList;
+		localList = new wordList;
+	}, [&] {
+		for (int i = 0; i < NR_TOKENS; i++) {
+			k->mapWord(localList, data->cleanTokens[i], data->tokenFile[i]);
+		}
+		return data->cleanBytes;
+	});
+	delete localList;
+
+	// Mapper-local lists, each one covering a slice of the files
+	struct wordList locals[NR_LOCALS];
+	unsigned long localBytes = 0;
+	for (int i = 0; i < NR_TOKENS; i++) {
+		int local = (data->tokenFile[i] - 1) * NR_LOCALS / NR_FILES;
+		mapWord(&locals[local], data->cleanTokens[i], data->tokenFile[i]);
+	}
+	for (int i = 0; i < NR_LOCALS; i++) {
+		localBytes += wordBytes(&locals[i]);
+	}
+
+	struct wordList *localCopies = NULL;
+	struct wordList *masterList = NULL;
+	measure("mergeLists", reps, [&] {
+		delete[] localCopies;
+		delete masterList;
+		localCopies = new wordList[NR_LOCALS];
+		for (int i = 0; i < NR_LOCALS; i++) {
+			localCopies[i].list = locals[i].list;
+		}
+		masterList = new wordList;
+	}, [&] {
+		for (int i = 0; i < NR_LOCALS; i++) {
+			k->mergeLists(&localCopies[i], masterList);
+		}
+		return localBytes;
+	});
+
+	vector<wordEntry> words(masterList->list.begin(), masterList->list.end());
+	unsigned long masterBytes = wordBytes(masterList);
+	delete[] localCopies;
+	delete masterList;
+
+	vector<wordEntry> sortedWords;
+	measure("sortWordlists", reps, [&] { sortedWords = words; }, [&] {
+		k->sortWordlists(sortedWords);
+		return masterBytes;
+	});
+
+	// What the reducers do between them once the list is sorted: bucket it by letter, then write every slice
+	// (the baseline writes whole letters, so its extra slices come out empty)
+	vector<wordEntry *> letters[26];
+	vector<wordEntry *> slice;
+	measure("writeLetters", reps, [&] { sortedWords = words; sortWordlists(sortedWords); }, [&] {
+		ostringstream out;
+		k->bucketLetters(sortedWords, letters);
+		for (int i = 0; i < 26; i++) {
+			for (int part = 0; part < NR_SLICES; part++) {
+				k->collectSlice(letters[i], part, NR_SLICES, slice);
+				k->writeWords(out, slice);
+			}
+		}
+		return (unsigned long)out.tellp();
+	});
+}
+
+int main(int argc, char **argv) {
+	int reps = 30;
+	const char *only = NULL;
+
+	if (argc > 1) {
+		reps = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		only = argv[2];
+	}
+
+	if (reps < 1) {
+		printf("Correct usage:\n./bench [repetitions] [kernel set]\n");
+		exit(1);
+	}
+
+	struct benchData data;
+	generateData(&data);
+
+	printf("Synthetic input: %d tokens (%lu bytes), %d distinct words, %d files\n", NR_TOKENS, data.tokenBytes, NR_VOCAB, NR_FILES);
+
+	int ran = 0;
+	for (size_t i = 0; i < sizeof(kernelSets) / sizeof(kernelSets[0]); i++) {
+		if (only == NULL || strcmp(only, kernelSets[i].name) == 0) {
+			runKernels(&kernelSets[i], &data, reps);
+			ran++;
+		}
+	}
+
+	if (ran == 0) {
+		printf("No kernel set named %s.\n", only);
+		exit(1);
+	}
+
+	return 0;
+}
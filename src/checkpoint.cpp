@@ -0,0 +1,294 @@
+#include <fcntl.h>
+#include <fstream>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+using namespace std;
+
+namespace mapreduce {
+
+// Modification time (in ns) for files on disk, FNV-1a of the contents for in-memory inputs.
+// Returns 0 if the file can't be looked at, which never matches anything in a manifest.
+unsigned long long inputStamp(struct fileinfo *file) {
+	if (file->data != NULL) {
+		unsigned long long h = 14695981039346656037ULL;
+		for (int i = 0; i < file->size; i++) {
+			h ^= (unsigned char)file->data[i];
+			h *= 1099511628211ULL;
+		}
+		return h != 0 ? h : 1;
+	}
+
+	struct stat info;
+	if (stat(file->fileName, &info) != 0) {
+		return 0;
+	}
+
+	unsigned long long stamp = (unsigned long long)info.st_mtim.tv_sec * 1000000000ULL + info.st_mtim.tv_nsec;
+	return stamp != 0 ? stamp : 1;
+}
+
+// Sets up cp in directory (creating it if needed). When resuming, files already listed in the manifest
+// (with the same name, size and stamp as now, and with their words file still there) are marked as finished,
+// and their cost drops to the size of their words file. Returns 0 on success, -1 otherwise.
+int openCheckpoint(struct checkpoint *cp, const char *directory, int resume, struct fileinfo *files, int nr_files) {
+	if (strlen(directory) >= MAX_BUFFER) {
+		return -1;
+	}
+
+	strcpy(cp->directory, directory);
+	mkdir(directory, 0755); // Fine if it's already there, fopen will complain if it's not usable
+
+	char path[2 * MAX_BUFFER];
+	snprintf(path, sizeof(path), "%s/manifest", cp->directory);
+
+	cp->finished.clear();
+	cp->stamps.clear();
+
+	unordered_map<int, struct fileinfo *> byId;
+	for (int i = 0; i < nr_files; i++) {
+		byId[files[i].id] = &files[i];
+		cp->stamps[files[i].id] = inputStamp(&files[i]);
+	}
+
+	// Entries that still hold, written back below so that stale ones (say, from a different input) are dropped
+	vector<struct fileinfo *> kept;
+
+	if (resume) {
+		FILE *previous = fopen(path, "r");
+		if (previous != NULL) {
+			int id;
+			int size;
+			unsigned long long stamp;
+			char name[MAX_BUFFER];
+			char line[2 * MAX_BUFFER];
+
+			// Line by line, so a half-written last line can't run into anything
+			while (fgets(line, sizeof(line), previous) != NULL) {
+				if (sscanf(line, "%d %d %llu %511[^\n]", &id, &size, &stamp, name) != 4) {
+					continue;
+				}
+
+				auto it = byId.find(id);
+				if (it == byId.end() || stamp == 0 || stamp != cp->stamps.at(id)) {
+					continue;
+				}
+
+				if (it->second->size != size || strcmp(it->second->fileName, name) != 0) {
+					continue;
+				}
+
+				char wordsPath[2 * MAX_BUFFER];
+				snprintf(wordsPath, sizeof(wordsPath), "%s/%d.words", cp->directory, id);
+
+				struct stat info;
+				if (stat(wordsPath, &info) != 0) {
+					continue;
+				}
+
+				if (cp->finished.insert(id).second) {
+					it->second->cost = info.st_size;
+					kept.push_back(it->second);
+				}
+			}
+
+			fclose(previous);
+		}
+	}
+
+	// The old manifest is only replaced once the new one is safely on disk, so failing here loses nothing
+	char tmpPath[2 * MAX_BUFFER];
+	snprintf(tmpPath, sizeof(tmpPath), "%s/manifest.tmp", cp->directory);
+
+	FILE *out = fopen(tmpPath, "w");
+	if (out == NULL) {
+		return -1;
+	}
+
+	int failed = 0;
+	for (auto file : kept) {
+		if (fprintf(out, "%d %d %llu %s\n", file->id, file->size, cp->stamps.at(file->id), file->fileName) < 0) {
+			failed = 1;
+			break;
+		}
+	}
+
+	if (fflush(out) != 0 || ferror(out)) {
+		failed = 1;
+	}
+	if (fsync(fileno(out)) != 0) {
+		failed = 1;
+	}
+	if (fclose(out) != 0) {
+		failed = 1;
+	}
+
+	if (failed || rename(tmpPath, path) != 0) {
+		unlink(tmpPath);
+		return -1;
+	}
+
+	// The rename itself lives in the directory
+	int dir = open(cp->directory, O_RDONLY | O_DIRECTORY);
+	if (dir < 0 || fsync(dir) != 0) {
+		failed = 1;
+	}
+	if (dir >= 0) {
+		close(dir);
+	}
+	if (failed) {
+		return -1;
+	}
+
+	cp->manifest = fopen(path, "a");
+	if (cp->manifest == NULL) {
+		return -1;
+	}
+
+	cp->pending.clear();
+	cp->pendingFiles = 0;
+	clock_gettime(CLOCK_MONOTONIC, &cp->lastSync);
+
+	pthread_mutex_init(&cp->manifestMutex, NULL);
+
+	return 0;
+}
+
+// Makes the pending manifest lines durable: first the words files they point to, then the lines themselves.
+// Has to be called with manifestMutex held. Returns 0 on success, -1 otherwise (the batch is dropped either way).
+int flushManifest(struct checkpoint *cp) {
+	if (cp->pendingFiles == 0) {
+		return 0;
+	}
+
+	int failed = 0;
+
+	// One sync for every words file (and rename) in the batch, instead of one per file
+	if (syncfs(fileno(cp->manifest)) != 0) {
+		failed = 1;
+	}
+
+	// A line that only partly made it is skipped when resuming
+	if (!failed && (fputs(cp->pending.c_str(), cp->manifest) == EOF || fflush(cp->manifest) != 0)) {
+		failed = 1;
+	}
+	if (!failed && fsync(fileno(cp->manifest)) != 0) {
+		failed = 1;
+	}
+
+	cp->pending.clear();
+	cp->pendingFiles = 0;
+	clock_gettime(CLOCK_MONOTONIC, &cp->lastSync);
+
+	return failed ? -1 : 0;
+}
+
+// Sync whatever the manifest is still holding back. Returns 0 on success, -1 otherwise.
+int syncCheckpoint(struct checkpoint *cp) {
+	pthread_mutex_lock(&cp->manifestMutex);
+	int result = flushManifest(cp);
+	pthread_mutex_unlock(&cp->manifestMutex);
+
+	return result;
+}
+
+// Returns -1 if the last manifest lines couldn't be synced
+int closeCheckpoint(struct checkpoint *cp) {
+	int result = syncCheckpoint(cp);
+
+	if (fclose(cp->manifest) != 0) {
+		result = -1;
+	}
+	pthread_mutex_destroy(&cp->manifestMutex);
+
+	return result;
+}
+
+// Add a finished file's words to localList. Returns -1 if the file isn't (or can't be) loaded.
+int loadCheckpoint(struct checkpoint *cp, struct fileinfo *file, struct wordList *localList) {
+	if (cp->finished.find(file->id) == cp->finished.end()) {
+		return -1;
+	}
+
+	char path[2 * MAX_BUFFER];
+	snprintf(path, sizeof(path), "%s/%d.words", cp->directory, file->id);
+
+	ifstream in;
+	in.open(path);
+	if (!in.is_open()) {
+		return -1;
+	}
+
+	string word;
+	while (getline(in, word)) {
+		combineWord(localList, word, file->id);
+	}
+
+	in.close();
+
+	return 0;
+}
+
+// Store the words of a freshly mapped file, then queue it for the manifest. Returns 0 on success, -1 otherwise.
+// The words go in under a temporary name first, and only a complete words file is renamed and listed,
+// so the manifest never points at a half-written (say, out of disk space) file. Syncing is left to
+// flushManifest, which covers a whole batch of files at once.
+int saveCheckpoint(struct checkpoint *cp, struct fileinfo *file, vector<string> &words) {
+	char path[2 * MAX_BUFFER];
+	char tmpPath[2 * MAX_BUFFER];
+	snprintf(path, sizeof(path), "%s/%d.words", cp->directory, file->id);
+	snprintf(tmpPath, sizeof(tmpPath), "%s/%d.tmp", cp->directory, file->id);
+
+	FILE *out = fopen(tmpPath, "w");
+	if (out == NULL) {
+		return -1;
+	}
+
+	int failed = 0;
+	for (auto &word : words) {
+		if (fputs(word.c_str(), out) == EOF || fputc('\n', out) == EOF) {
+			failed = 1;
+			break;
+		}
+	}
+
+	if (fflush(out) != 0 || ferror(out)) {
+		failed = 1;
+	}
+	if (fclose(out) != 0) {
+		failed = 1;
+	}
+
+	if (failed || rename(tmpPath, path) != 0) {
+		unlink(tmpPath);
+		return -1;
+	}
+
+	char line[3 * MAX_BUFFER];
+	snprintf(line, sizeof(line), "%d %d %llu %s\n", file->id, file->size, cp->stamps.at(file->id), file->fileName);
+
+	pthread_mutex_lock(&cp->manifestMutex);
+
+	cp->pending += line;
+	cp->pendingFiles++;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	int result = 0;
+	if (cp->pendingFiles >= MANIFEST_BATCH || now.tv_sec - cp->lastSync.tv_sec >= MANIFEST_INTERVAL) {
+		result = flushManifest(cp);
+	}
+
+	pthread_mutex_unlock(&cp->manifestMutex);
+
+	return result;
+}
+
+} // namespace mapreduce
@@ -0,0 +1,45 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mapreduce.h"
+
+#define MANIFEST_BATCH 32	// Saved files whose manifest lines may wait for a sync...
+#define MANIFEST_INTERVAL 5 // ...or seconds since the last sync, whichever comes first
+
+namespace mapreduce {
+
+// Every mapped file leaves <directory>/<id>.words behind (its distinct words, one per line), and is then
+// listed in <directory>/manifest as "id size stamp name". Resuming maps only what's not listed there.
+// The stamp is the modification time for files on disk and a hash of the contents for in-memory inputs.
+// Manifest lines are synced in batches (and once more when mapping ends); until then a crash only costs
+// remapping the files in the batch.
+struct checkpoint {
+	char directory[MAX_BUFFER];
+	FILE *manifest;
+	pthread_mutex_t manifestMutex;
+	std::unordered_set<int> finished;				   // Ids that can be loaded instead of mapped
+	std::unordered_map<int, unsigned long long> stamps; // Every input's stamp, taken before mapping starts
+	std::string pending;								// Manifest lines waiting for the next sync
+	int pendingFiles;
+	struct timespec lastSync;
+};
+
+int openCheckpoint(struct checkpoint *cp, const char *directory, int resume, struct fileinfo *files, int nr_files);
+int syncCheckpoint(struct checkpoint *cp);
+int closeCheckpoint(struct checkpoint *cp);
+
+int loadCheckpoint(struct checkpoint *cp, struct fileinfo *file, struct wordList *localList);
+int saveCheckpoint(struct checkpoint *cp, struct fileinfo *file, std::vector<std::string> &words);
+
+} // namespace mapreduce
+
+#endif
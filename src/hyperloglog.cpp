@@ -0,0 +1,179 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "hyperloglog.h"
+
+using namespace std;
+
+namespace mapreduce {
+
+// FNV-1a, with murmur's finalizer on top so the high bits (used as the register index) are well mixed
+uint64_t hashWord(const string &word) {
+	uint64_t h = 14695981039346656037ULL;
+	for (char c : word) {
+		h ^= (unsigned char)c;
+		h *= 1099511628211ULL;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+void hllClear(struct hyperLogLog *sketch) {
+	memset(sketch->registers, 0, sizeof(sketch->registers));
+}
+
+void hllAdd(struct hyperLogLog *sketch, const string &word) {
+	uint64_t h = hashWord(word);
+
+	int index = h >> (64 - HLL_BITS);
+	uint64_t rest = h << HLL_BITS;
+
+	// Position of the first 1 bit in what's left (all zeroes counts as the last position + 1)
+	unsigned char rank = rest == 0 ? 64 - HLL_BITS + 1 : __builtin_clzll(rest) + 1;
+
+	if (rank > sketch->registers[index]) {
+		sketch->registers[index] = rank;
+	}
+}
+
+void hllMerge(struct hyperLogLog *into, struct hyperLogLog *from) {
+	for (int i = 0; i < HLL_REGISTERS; i++) {
+		if (from->registers[i] > into->registers[i]) {
+			into->registers[i] = from->registers[i];
+		}
+	}
+}
+
+// https://en.wikipedia.org/wiki/HyperLogLog
+double hllEstimate(struct hyperLogLog *sketch) {
+	double m = HLL_REGISTERS;
+	double alpha = 0.7213 / (1 + 1.079 / m);
+
+	double sum = 0;
+	int zeroes = 0;
+	for (int i = 0; i < HLL_REGISTERS; i++) {
+		sum += ldexp(1.0, -sketch->registers[i]);
+		if (sketch->registers[i] == 0) {
+			zeroes++;
+		}
+	}
+
+	double estimate = alpha * m * m / sum;
+
+	// Small cardinalities are better served by linear counting
+	if (estimate <= 2.5 * m && zeroes > 0) {
+		estimate = m * log(m / zeroes);
+	}
+
+	return estimate;
+}
+
+// Add the words in buffer to sketch, tokenized the same way mappers do it.
+// Words cut off by the start/end of the range are skipped unless the range starts/ends with the file.
+void sketchRange(const char *buffer, size_t len, bool fileStart, bool fileEnd, struct hyperLogLog *sketch) {
+	size_t i = 0;
+
+	if (!fileStart) {
+		while (i < len && !isspace(buffer[i])) {
+			i++;
+		}
+	}
+
+	string word;
+	bool inWord = false;
+	for (; i < len; i++) {
+		if (isspace(buffer[i])) {
+			if (inWord) {
+				hllAdd(sketch, word);
+				word.clear();
+				inWord = false;
+			}
+		} else {
+			inWord = true;
+			if (isalpha(buffer[i])) {
+				word += tolower(buffer[i]);
+			}
+		}
+	}
+
+	if (inWord && fileEnd) {
+		hllAdd(sketch, word);
+	}
+}
+
+// Sketch evenly spread SAMPLE_RANGE slices of file, adding up to at least 1/SAMPLE_FRACTION of it.
+// Returns how many bytes were sampled.
+unsigned long sketchFile(struct fileinfo *file, struct hyperLogLog *sketch) {
+	unsigned long size = file->size;
+	unsigned long wanted = size / SAMPLE_FRACTION > SAMPLE_RANGE ? size / SAMPLE_FRACTION : SAMPLE_RANGE;
+	unsigned long ranges = (wanted + SAMPLE_RANGE - 1) / SAMPLE_RANGE;
+
+	unsigned long rangeSize = SAMPLE_RANGE;
+
+	// Small enough to just take all of it
+	if (ranges * SAMPLE_RANGE >= size) {
+		ranges = 1;
+		rangeSize = size;
+	}
+
+	FILE *diskFile = NULL;
+	vector<char> buffer;
+	if (file->data == NULL) {
+		diskFile = fopen(file->fileName, "r");
+		if (diskFile == NULL) {
+			return 0;
+		}
+		buffer.resize(rangeSize);
+	}
+
+	unsigned long sampled = 0;
+	for (unsigned long i = 0; i < ranges; i++) {
+		unsigned long offset = i * (size / ranges);
+		const char *range;
+		size_t len;
+
+		if (diskFile != NULL) {
+			fseek(diskFile, offset, SEEK_SET);
+			len = fread(buffer.data(), 1, rangeSize, diskFile);
+			range = buffer.data();
+		} else {
+			range = file->data + offset;
+			len = rangeSize;
+		}
+
+		sketchRange(range, len, offset == 0, offset + len >= size, sketch);
+		sampled += len;
+	}
+
+	if (diskFile != NULL) {
+		fclose(diskFile);
+	}
+
+	return sampled;
+}
+
+// Scale a distinct count seen in a sample up to the whole input
+unsigned long extrapolateWords(double sampledWords, unsigned long sampledBytes, unsigned long totalBytes) {
+	if (sampledBytes == 0) {
+		return 0;
+	}
+
+	if (sampledBytes >= totalBytes) {
+		return sampledWords;
+	}
+
+	return sampledWords * pow((double)totalBytes / sampledBytes, HEAPS_BETA);
+}
+
+} // namespace mapreduce
@@ -0,0 +1,31 @@
+#ifndef HYPERLOGLOG_H
+#define HYPERLOGLOG_H
+
+#include <string>
+
+#include "mapreduce.h"
+
+#define HLL_BITS 12					// 2^12 registers, ~1.6% standard error
+#define HLL_REGISTERS (1 << HLL_BITS)
+#define SAMPLE_RANGE 4096			// Bytes read at a time when sampling a file
+#define SAMPLE_FRACTION 8			// Sample (at least) 1/SAMPLE_FRACTION of every file
+#define HEAPS_BETA 0.5				// Vocabulary grows roughly as words^beta (Heaps' law)
+
+namespace mapreduce {
+
+// Distinct-count sketch - merging two of them gives the sketch of both inputs together
+struct hyperLogLog {
+	unsigned char registers[HLL_REGISTERS];
+};
+
+void hllClear(struct hyperLogLog *sketch);
+void hllAdd(struct hyperLogLog *sketch, const std::string &word);
+void hllMerge(struct hyperLogLog *into, struct hyperLogLog *from);
+double hllEstimate(struct hyperLogLog *sketch);
+
+unsigned long sketchFile(struct fileinfo *file, struct hyperLogLog *sketch);
+unsigned long extrapolateWords(double sampledWords, unsigned long sampledBytes, unsigned long totalBytes);
+
+} // namespace mapreduce
+
+#endif
@@ -0,0 +1,395 @@
+#include <fstream>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "checkpoint.h"
+#include "hyperloglog.h"
+#include "indexbuilder.h"
+
+using namespace std;
+using namespace mapreduce;
+
+IndexSink::IndexSink() {
+	pthread_mutex_init(&partsMutex, NULL);
+	for (int i = 0; i < 26; i++) {
+		partsDone[i] = 0;
+	}
+}
+
+IndexSink::~IndexSink() {
+	pthread_mutex_destroy(&partsMutex);
+}
+
+int IndexSink::writeLetterPart(char letter, int part, int parts, vector<wordEntry *> &words) {
+	if (parts == 1) {
+		return writeLetter(letter, words);
+	}
+
+	// The reducer's words go away with it, so keep a copy
+	vector<wordEntry> copy;
+	for (auto entry : words) {
+		copy.push_back(*entry);
+	}
+
+	if (!storePart(pendingParts, letter, part, parts, copy)) {
+		return 0;
+	}
+
+	// Nobody else touches this letter anymore
+	int index = letter - 'a';
+
+	vector<wordEntry *> all;
+	for (auto &slice : pendingParts[index]) {
+		for (auto &entry : slice) {
+			all.push_back(&entry);
+		}
+	}
+
+	int result = writeLetter(letter, all);
+
+	pendingParts[index].clear();
+
+	return result;
+}
+
+TextFileSink::TextFileSink(const char *directory) : directory(directory) {
+}
+
+int TextFileSink::writeLetter(char letter, vector<wordEntry *> &words) {
+	ofstream file;
+
+	string fileName = directory + "/" + letter + ".txt";
+	file.open(fileName);
+	if (!file.is_open()) {
+		return -1;
+	}
+
+	writeWords(file, words);
+
+	// Failed writes stick around in the stream state, and close() adds its own
+	file.close();
+
+	return file.fail() ? -1 : 0;
+}
+
+int TextFileSink::writeLetterPart(char letter, int part, int parts, vector<wordEntry *> &words) {
+	if (parts == 1) {
+		return writeLetter(letter, words);
+	}
+
+	ostringstream text;
+	writeWords(text, words);
+
+	string rendered = text.str();
+	if (!storePart(pendingText, letter, part, parts, rendered)) {
+		return 0;
+	}
+
+	// Last slice in writes the file, in slice order
+	int index = letter - 'a';
+
+	ofstream file;
+
+	string fileName = directory + "/" + letter + ".txt";
+	file.open(fileName);
+
+	for (auto &slice : pendingText[index]) {
+		file << slice;
+	}
+
+	file.close();
+
+	pendingText[index].clear();
+
+	return file.fail() ? -1 : 0;
+}
+
+int MemorySink::writeLetter(char letter, vector<wordEntry *> &words) {
+	// Only one reducer ever gets a given letter, so no locking needed
+	vector<wordEntry> &out = letters[letter - 'a'];
+
+	out.clear();
+	for (auto entry : words) {
+		out.push_back(*entry);
+	}
+
+	return 0;
+}
+
+CallbackSink::CallbackSink(wordCallback callback, void *data) : callback(callback), data(data) {}
+
+int CallbackSink::writeLetter(char letter, vector<wordEntry *> &words) {
+	for (auto entry : words) {
+		callback(letter, *entry, data);
+	}
+
+	return 0;
+}
+
+IndexBuilder::IndexBuilder(int nr_mappers, int nr_reducers) : nr_mappers(nr_mappers), nr_reducers(nr_reducers), calibrate(0), verbose(0), resume(0) {}
+
+IndexBuilder::~IndexBuilder() {}
+
+int IndexBuilder::addFile(const char *fileName) {
+	if (strlen(fileName) >= MAX_BUFFER || access(fileName, R_OK) != 0) {
+		return -1;
+	}
+
+	struct fileinfo newFile;
+	strcpy(newFile.fileName, fileName);
+	newFile.id = files.size() + 1;
+	newFile.size = fsize(newFile.fileName);
+	newFile.data = NULL;
+	newFile.cost = newFile.size;
+
+	files.push_back(newFile);
+
+	return newFile.id;
+}
+
+int IndexBuilder::addBuffer(const char *name, const char *data, size_t size) {
+	if (strlen(name) >= MAX_BUFFER || size > INT_MAX || (data == NULL && size > 0)) {
+		return -1;
+	}
+
+	struct fileinfo newFile;
+	strcpy(newFile.fileName, name);
+	newFile.id = files.size() + 1;
+	newFile.size = size;
+	newFile.data = data != NULL ? data : ""; // NULL data means "read fileName", an empty buffer still isn't that
+	newFile.cost = newFile.size;
+
+	files.push_back(newFile);
+
+	return newFile.id;
+}
+
+void IndexBuilder::setCalibrate(int calibrate) {
+	this->calibrate = calibrate;
+}
+
+void IndexBuilder::setVerbose(int verbose) {
+	this->verbose = verbose;
+}
+
+void IndexBuilder::setCheckpoint(const char *directory, int resume) {
+	checkpointDir = directory;
+	this->resume = resume;
+}
+
+int IndexBuilder::build(IndexSink *sink) {
+	if (sink == NULL || nr_mappers < AUTO_THREADS || nr_reducers < AUTO_THREADS) {
+		return -1;
+	}
+
+	// greedyPartition reorders the files, and build() should be repeatable
+	vector<struct fileinfo> inputs = files;
+	int nr_files = inputs.size();
+
+	// Checkpoint ids and names have to match the inputs as they are now, so this goes before any reordering.
+	// It also marks down resumed files' cost, so that picking thread counts and partitioning leave them out.
+	struct checkpoint cp;
+	struct checkpoint *checkpoint = NULL;
+	if (!checkpointDir.empty()) {
+		if (openCheckpoint(&cp, checkpointDir.c_str(), resume, inputs.data(), nr_files) < 0) {
+			if (verbose) {
+				printf("Could not open checkpoint in %s.\n", checkpointDir.c_str());
+			}
+			return -1;
+		}
+		checkpoint = &cp;
+
+		if (verbose && resume) {
+			printf("Resuming: %zu of %d files already mapped.\n", cp.finished.size(), nr_files);
+		}
+	}
+
+	int mappers = nr_mappers;
+	int reducers = nr_reducers;
+	if (mappers == AUTO_THREADS || reducers == AUTO_THREADS) {
+		autotune(inputs.data(), nr_files, &mappers, &reducers, calibrate, verbose);
+	}
+
+	int NUM_THREADS = mappers + reducers;
+
+	pthread_barrier_t mapstop;
+	pthread_barrier_init(&mapstop, NULL, NUM_THREADS);
+
+	// Compose arguments
+
+	vector<pthread_t> threads(NUM_THREADS);
+	vector<struct args> arguments(NUM_THREADS);
+
+	struct wordList masterList;
+	pthread_mutex_init(&masterList.listMutex, NULL);
+
+	struct writingQueue masterQueue;
+	pthread_mutex_init(&masterQueue.queueMutex, NULL);
+	masterQueue.planned = 0;
+	masterQueue.failed = 0;
+	masterQueue.nr_reducers = reducers;
+
+	for (int i = 0; i < NUM_THREADS; i++) {
+		arguments[i].nr_files = 0;
+		arguments[i].nr_bytes = 0;
+		arguments[i].files = NULL;
+		arguments[i].masterList = &masterList;
+		arguments[i].writeQueue = &masterQueue;
+		arguments[i].sink = sink;
+		arguments[i].verbose = verbose;
+		arguments[i].sketch = NULL;
+		arguments[i].sampledBytes = 0;
+		arguments[i].expectedWords = 0;
+		arguments[i].checkpoint = checkpoint;
+		arguments[i].gate = NULL;
+	}
+
+	// Balance files for mapping
+
+	struct fileinfo **subsets = (struct fileinfo **)malloc(mappers * sizeof(struct fileinfo *));
+	for (int i = 0; i < mappers; i++) {
+		subsets[i] = (struct fileinfo *)malloc((nr_files > 0 ? nr_files : 1) * sizeof(struct fileinfo)); // Maximum files per subset
+	}
+
+	vector<int> subsetSums(mappers);
+	vector<int> subsetCounts(mappers);
+	greedyPartition(inputs.data(), nr_files, mappers, subsets, subsetSums.data(), subsetCounts.data());
+
+	// Assign files in arguments
+
+	for (int i = 0; i < mappers; i++) {
+		arguments[i].nr_files = subsetCounts[i];
+		arguments[i].nr_bytes = subsetSums[i];
+		arguments[i].files = subsets[i];
+	}
+
+	if (verbose > 1) {
+		for (int i = 0; i < mappers; i++) {
+			printf("Subset %d (Total %d):\n", i + 1, subsetSums[i]);
+			for (int j = 0; j < subsetCounts[i]; j++) {
+				printf("- File: %s, id: %d, size: %d, cost: %d\n", subsets[i][j].fileName, subsets[i][j].id, subsets[i][j].size, subsets[i][j].cost);
+			}
+			printf("\n");
+		}
+	}
+
+	// Estimate vocabulary sizes, so neither the local lists nor the masterList (under its mutex) rehash as they grow
+
+	int r;
+
+	vector<struct hyperLogLog> sketches(mappers);
+	vector<int> estimating(mappers);
+	for (int i = 0; i < mappers; i++) {
+		arguments[i].sketch = &sketches[i];
+
+		r = pthread_create(&threads[i], NULL, &estimator, &arguments[i]);
+		estimating[i] = (r == 0);
+		if (r) {
+			// Not worth failing over, do it here instead
+			estimator(&arguments[i]);
+		}
+	}
+
+	struct hyperLogLog totalSketch;
+	hllClear(&totalSketch);
+	unsigned long sampledBytes = 0;
+	unsigned long totalBytes = 0;
+
+	for (int i = 0; i < mappers; i++) {
+		if (estimating[i]) {
+			pthread_join(threads[i], NULL);
+		}
+
+		hllMerge(&totalSketch, &sketches[i]);
+		sampledBytes += arguments[i].sampledBytes;
+		totalBytes += arguments[i].nr_bytes;
+	}
+
+	unsigned long expectedWords = extrapolateWords(hllEstimate(&totalSketch), sampledBytes, totalBytes);
+	masterList.list.reserve(expectedWords);
+
+	if (verbose) {
+		printf("Expecting %lu distinct words (sampled %lu of %lu bytes).\n", expectedWords, sampledBytes, totalBytes);
+	}
+
+	// Initialize threads
+
+	struct startGate gate;
+	initGate(&gate);
+
+	int started = 0;
+
+	// Note for self: last thread will be (NUM_THREADS - 1)
+	for (int i = 0; i < NUM_THREADS; i++) {
+		arguments[i].thread_id = i;
+		arguments[i].mapstop = &mapstop;
+		arguments[i].gate = &gate;
+
+		if (i < mappers) {
+			r = pthread_create(&threads[i], NULL, &mapper, &arguments[i]);
+		} else {
+			r = pthread_create(&threads[i], NULL, &reducer, &arguments[i]);
+		}
+
+		if (r) {
+			if (verbose) {
+				printf("Thread creation failed for %d (%s)\n", i, i < mappers ? "mapper" : "reducer");
+			}
+			break;
+		}
+
+		started++;
+	}
+
+	// Nobody has touched the barrier yet, so if someone's missing everyone can still just leave
+	int result = (started == NUM_THREADS) ? 0 : -1;
+	openGate(&gate, result == 0 ? 1 : -1);
+
+	// Await threads
+
+	void *status;
+	for (int i = 0; i < started; i++) {
+		r = pthread_join(threads[i], &status);
+
+		if (r) {
+			if (verbose) {
+				printf("Error on wait for thread %d (%s)\n", i, i < mappers ? "mapper" : "reducer");
+			}
+			result = -1;
+		}
+	}
+
+	// Whatever the sink couldn't take is missing from the index
+	if (masterQueue.failed) {
+		result = -1;
+	}
+
+	if (verbose > 1) {
+		printf("Found %zu distinct words.\n", masterList.list.size());
+	}
+
+	// Wrap-up (free & close)
+
+	for (int i = 0; i < mappers; i++) {
+		free(subsets[i]);
+	}
+	free(subsets);
+
+	// Only means the next run might map a few files again, so the index itself is still fine
+	if (checkpoint != NULL && closeCheckpoint(checkpoint) < 0 && verbose) {
+		printf("Could not sync the checkpoint manifest.\n");
+	}
+
+	destroyGate(&gate);
+	pthread_barrier_destroy(&mapstop);
+	pthread_mutex_destroy(&masterList.listMutex);
+	pthread_mutex_destroy(&masterQueue.queueMutex);
+
+	return result;
+}
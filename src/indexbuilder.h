@@ -0,0 +1,131 @@
+#ifndef INDEXBUILDER_H
+#define INDEXBUILDER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#define AUTO_THREADS 0 // Mapper/reducer count meaning "pick one for me"
+
+// A word along with the ids of the files it appears in
+typedef std::pair<std::string, std::vector<int>> wordEntry;
+
+// The pipeline itself lives in mapreduce.h, which isn't part of the library's interface
+namespace mapreduce {
+struct fileinfo;
+}
+
+// Where the reducers deliver the finished index, one letter at a time.
+// Every letter is delivered exactly once (empty letters included), but different letters may be
+// delivered at the same time from different reducers.
+class IndexSink {
+public:
+	IndexSink();
+	virtual ~IndexSink();
+
+	// words are in output order (most files first, then alphabetical), each with its file ids sorted.
+	// Returns 0 on success, -1 otherwise (which makes build() fail too).
+	virtual int writeLetter(char letter, std::vector<wordEntry *> &words) = 0;
+
+	// Big letters come in as slices (part out of parts, in any order, possibly at the same time).
+	// By default slices are kept until the letter is complete, then handed to writeLetter.
+	virtual int writeLetterPart(char letter, int part, int parts, std::vector<wordEntry *> &words);
+
+protected:
+	// Files payload as slice part of letter into pending[letter] (one list of slices per letter, kept by the caller).
+	// Returns true for whoever stores the last slice - the letter is then theirs alone, slices in order.
+	template <typename T>
+	bool storePart(std::vector<T> *pending, char letter, int part, int parts, T &payload) {
+		int index = letter - 'a';
+
+		pthread_mutex_lock(&partsMutex);
+
+		pending[index].resize(parts);
+		std::swap(pending[index][part], payload);
+		partsDone[index]++;
+
+		bool complete = (partsDone[index] == parts);
+		if (complete) {
+			partsDone[index] = 0;
+		}
+
+		pthread_mutex_unlock(&partsMutex);
+
+		return complete;
+	}
+
+private:
+	pthread_mutex_t partsMutex;
+	int partsDone[26];
+	std::vector<std::vector<wordEntry>> pendingParts[26];
+};
+
+// The usual a.txt ... z.txt files, written into directory
+class TextFileSink : public IndexSink {
+public:
+	TextFileSink(const char *directory = ".");
+	int writeLetter(char letter, std::vector<wordEntry *> &words);
+
+	// Slices are turned into text right away (in parallel), only the file writing waits for the whole letter
+	int writeLetterPart(char letter, int part, int parts, std::vector<wordEntry *> &words);
+
+private:
+	std::string directory;
+	std::vector<std::string> pendingText[26];
+};
+
+// Keeps a copy of the whole index, letters[0] being 'a'
+class MemorySink : public IndexSink {
+public:
+	int writeLetter(char letter, std::vector<wordEntry *> &words);
+
+	std::vector<wordEntry> letters[26];
+};
+
+// Calls callback for every word (data is passed along as-is)
+typedef void (*wordCallback)(char letter, const wordEntry &word, void *data);
+
+class CallbackSink : public IndexSink {
+public:
+	CallbackSink(wordCallback callback, void *data);
+	int writeLetter(char letter, std::vector<wordEntry *> &words);
+
+private:
+	wordCallback callback;
+	void *data;
+};
+
+// Runs the whole map-reduce over a set of inputs (files and/or memory buffers) and hands the result to a sink.
+// Inputs get ids in the order they're added, starting from 1.
+class IndexBuilder {
+public:
+	IndexBuilder(int nr_mappers = AUTO_THREADS, int nr_reducers = AUTO_THREADS);
+	~IndexBuilder();
+
+	// Both return the new input's id, or -1 if it can't be used
+	int addFile(const char *fileName);
+	int addBuffer(const char *name, const char *data, size_t size); // data has to outlive build(), NULL only if size is 0
+
+	void setCalibrate(int calibrate);
+	void setVerbose(int verbose);
+
+	// Save every mapped file into directory; with resume, files saved there by an earlier run aren't mapped again
+	void setCheckpoint(const char *directory, int resume);
+
+	// Returns 0 on success, -1 otherwise
+	int build(IndexSink *sink);
+
+private:
+	std::vector<struct mapreduce::fileinfo> files;
+	int nr_mappers;
+	int nr_reducers;
+	int calibrate;
+	int verbose;
+	std::string checkpointDir; // Empty when not checkpointing
+	int resume;
+};
+
+#endif
@@ -0,0 +1,658 @@
+#include <ctype.h>
+#include <fstream>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <streambuf>
+
+#include "checkpoint.h"
+#include "hyperloglog.h"
+#include "indexbuilder.h"
+#include "mapreduce.h"
+
+using namespace std;
+
+namespace mapreduce {
+
+// Debug function
+void printArgs(struct args myargs) {
+	printf("thread_id %d; nr_files %d\n", myargs.thread_id, myargs.nr_files);
+	if (myargs.nr_files > 0) {
+		for (int i = 0; i < myargs.nr_files; i++) {
+			printf("File %d: id %d; filename %s; size %d\n", i, myargs.files[i].id, myargs.files[i].fileName, myargs.files[i].size);
+		}
+	}
+}
+
+// Returns the size of a file
+unsigned long fsize(char *file) {
+	FILE *f = fopen(file, "r");
+	fseek(f, 0, SEEK_END);
+	unsigned long len = (unsigned long)ftell(f);
+	fclose(f);
+
+	return len;
+}
+
+// Sanitize input and write into output
+void processString(string &input, string &output) {
+	output.clear(); // Clear output first
+	for (char c : input) {
+		if (isalpha(c)) {
+			output += tolower(c);
+		}
+	}
+}
+
+// Record that word shows up in fileId. Returns 1 if that wasn't known yet.
+int mapWord(struct wordList *localList, const string &word, int fileId) {
+	vector<int> &wordInfo = localList->list[word];
+
+	// If it doesn't exist or it exists but without the current file id
+	if (wordInfo.empty() || std::find(wordInfo.begin(), wordInfo.end(), fileId) == wordInfo.end()) {
+		wordInfo.push_back(fileId);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Combiner version of mapWord: a file's words are all added before the next file's, so the last id in a
+// word's list doubles as a "last seen in" stamp. Repeats within a file cost one comparison and never
+// touch the list. Returns 1 if fileId is new for word.
+int combineWord(struct wordList *localList, const string &word, int fileId) {
+	vector<int> &wordInfo = localList->list[word];
+
+	if (!wordInfo.empty() && wordInfo.back() == fileId) {
+		return 0;
+	}
+
+	wordInfo.push_back(fileId);
+	return 1;
+}
+
+// Combiner version of mergeLists: every file is mapped by exactly one mapper, so local lists never share
+// (word, file) pairs and each word's ids can be moved or appended in one go, without searching.
+// localList is left empty.
+void combineLists(struct wordList *localList, struct wordList *masterList) {
+	for (auto &wordInfo : localList->list) {
+		auto it = masterList->list.find(wordInfo.first);
+		if (it == masterList->list.end()) {
+			masterList->list.emplace(wordInfo.first, std::move(wordInfo.second));
+		} else {
+			std::vector<int> &masterFileIds = it->second;
+			masterFileIds.insert(masterFileIds.end(), wordInfo.second.begin(), wordInfo.second.end());
+		}
+	}
+
+	localList->list.clear();
+}
+
+// Add everything from localList into masterList (locking is up to the caller)
+void mergeLists(struct wordList *localList, struct wordList *masterList) {
+	for (auto &wordInfo : localList->list) {
+		const std::string &word = wordInfo.first;
+		std::vector<int> &localFileIds = wordInfo.second;
+
+		// Check if the word already exists in the master list
+		auto it = masterList->list.find(word);
+		if (it == masterList->list.end()) {
+			// Word does not exist, add it with file id
+			masterList->list[word] = localFileIds;
+		} else {
+			// Word exists, update its vector of file IDs
+			std::vector<int> &masterFileIds = it->second;
+
+			// Iterate through the local file IDs and add any that are missing
+			for (int localFileId : localFileIds) {
+				if (std::find(masterFileIds.begin(), masterFileIds.end(), localFileId) == masterFileIds.end()) {
+					// Not found in this file before, insert it
+					masterFileIds.push_back(localFileId);
+				}
+			}
+		}
+	}
+}
+
+bool compareWordlists(const wordEntry &a, const wordEntry &b) {
+	if (a.second.size() != b.second.size()) {
+		return a.second.size() > b.second.size();
+	}
+
+	// If sizes are equal, compare by word
+	return a.first < b.first;
+}
+
+void sortWordlists(vector<wordEntry> &words) {
+	std::sort(words.begin(), words.end(), &compareWordlists);
+}
+
+// Write words out in the word:[id id id] format
+void writeWords(ostream &out, vector<wordEntry *> &words) {
+	for (auto entry : words) {
+		auto &[word, files] = *entry;
+
+		out << word << ":[";
+
+		// g++ screams at me if I don't use size_t
+		for (size_t i = 0; i < files.size(); i++) {
+			out << files[i];
+			if (i < files.size() - 1) { // if not last element
+				out << " ";
+			}
+		}
+
+		out << "]\n";
+	}
+}
+
+// Roughly what writing an entry costs: word:[ids]\n, counting every id as 4 characters with its space
+unsigned long entryCost(const string &word, const vector<int> &files) {
+	return word.size() + 4 + 4 * files.size();
+}
+
+// Where slice part of parts starts and ends in letter, cutting it into slices of about the same cost
+void sliceBounds(vector<wordEntry *> &letter, int part, int parts, size_t *begin, size_t *end) {
+	unsigned long total = 0;
+	for (auto entry : letter) {
+		total += entryCost(entry->first, entry->second);
+	}
+
+	unsigned long from = total * part / parts;
+	unsigned long to = total * (part + 1) / parts;
+
+	// A word belongs to the slice its starting cost falls in
+	unsigned long cost = 0;
+	*begin = letter.size();
+	*end = letter.size();
+	for (size_t i = 0; i < letter.size(); i++) {
+		if (cost >= from && *begin == letter.size()) {
+			*begin = i;
+		}
+		if (cost >= to && part < parts - 1) {
+			*end = i;
+			break;
+		}
+		cost += entryCost(letter[i]->first, letter[i]->second);
+	}
+
+	if (*begin > *end) {
+		*begin = *end;
+	}
+}
+
+// Sort every word into its letter's bucket, keeping the order they're in
+void bucketLetters(vector<wordEntry> &sortedWords, vector<wordEntry *> letters[26]) {
+	for (int i = 0; i < 26; i++) {
+		letters[i].clear();
+	}
+
+	for (auto &entry : sortedWords) {
+		if (!entry.first.empty() && entry.first[0] >= 'a' && entry.first[0] <= 'z') {
+			letters[entry.first[0] - 'a'].push_back(&entry);
+		}
+	}
+}
+
+// Pick out slice part of parts of a letter's words, with their file ids sorted
+void collectSlice(vector<wordEntry *> &letter, int part, int parts, vector<wordEntry *> &words) {
+	size_t begin;
+	size_t end;
+	sliceBounds(letter, part, parts, &begin, &end);
+
+	words.assign(letter.begin() + begin, letter.begin() + end);
+	for (auto entry : words) {
+		std::sort(entry->second.begin(), entry->second.end());
+	}
+}
+
+// Lets in-memory inputs be read the same way files are
+struct memoryBuffer : std::streambuf {
+	memoryBuffer(const char *data, size_t size) {
+		char *start = const_cast<char *>(data);
+		setg(start, start, start + size);
+	}
+};
+
+// Map every word in file (stopping after maxBytes, if not 0). Returns how many bytes were read.
+// If fileWords isn't NULL, every distinct word in the file is also added to it.
+unsigned long mapFile(struct fileinfo *file, struct wordList *localList, unsigned long maxBytes, vector<string> *fileWords) {
+	memoryBuffer buffer(file->data, file->data != NULL ? file->size : 0);
+	istream in(&buffer);
+
+	ifstream diskFile;
+	if (file->data == NULL) {
+		diskFile.open(file->fileName);
+		in.rdbuf(diskFile.rdbuf());
+	}
+
+	unsigned long bytes = 0;
+	string word;
+	string goodWord;
+	while (in >> word) {
+		processString(word, goodWord);
+		if (combineWord(localList, goodWord, file->id) && fileWords != NULL) {
+			fileWords->push_back(goodWord);
+		}
+
+		bytes += word.size() + 1;
+		if (maxBytes > 0 && bytes >= maxBytes) {
+			break;
+		}
+	}
+
+	return bytes;
+}
+
+// Pre-pass over a mapper's files: samples them so that the dictionaries can be sized before mapping starts
+void *estimator(void *arg) {
+	struct args *myargs = (struct args *)arg;
+
+	hllClear(myargs->sketch);
+	myargs->sampledBytes = 0;
+
+	for (int i = 0; i < myargs->nr_files; i++) {
+		// Resumed files are only loaded, there's no point in reading them
+		if (myargs->checkpoint != NULL && myargs->checkpoint->finished.count(myargs->files[i].id) > 0) {
+			continue;
+		}
+
+		myargs->sampledBytes += sketchFile(&myargs->files[i], myargs->sketch);
+	}
+
+	myargs->expectedWords = extrapolateWords(hllEstimate(myargs->sketch), myargs->sampledBytes, myargs->nr_bytes);
+
+	return 0;
+}
+
+void *mapper(void *arg) {
+	struct args myargs = *(struct args *)arg;
+
+	if (!waitAtGate(myargs.gate)) {
+		return 0;
+	}
+
+	if (myargs.verbose) {
+		printf("Mapper %d started.\n", myargs.thread_id);
+
+		printf("Mapper %d has %d files.\n", myargs.thread_id, myargs.nr_files);
+	}
+
+	// Partial list that's written at the end, when it's filled out
+	struct wordList localList;
+	localList.list.reserve(myargs.expectedWords);
+
+	// Words of the file being mapped, for checkpointing
+	vector<string> fileWords;
+	int resumed = 0;
+
+	if (myargs.nr_files > 0) {
+		for (int i = 0; i < myargs.nr_files; i++) {
+			if (myargs.checkpoint == NULL) {
+				mapFile(&myargs.files[i], &localList, 0, NULL);
+				continue;
+			}
+
+			// Already done in a previous run
+			if (loadCheckpoint(myargs.checkpoint, &myargs.files[i], &localList) == 0) {
+				resumed++;
+				continue;
+			}
+
+			fileWords.clear();
+			mapFile(&myargs.files[i], &localList, 0, &fileWords);
+			if (saveCheckpoint(myargs.checkpoint, &myargs.files[i], fileWords) < 0 && myargs.verbose) {
+				printf("Could not checkpoint %s.\n", myargs.files[i].fileName);
+			}
+		}
+	}
+
+	if (myargs.verbose && resumed > 0) {
+		printf("Mapper %d resumed %d files from the checkpoint.\n", myargs.thread_id, resumed);
+	}
+
+	// Processed everything locally, now to write them into the masterList
+
+	pthread_mutex_lock(&myargs.masterList->listMutex);
+	combineLists(&localList, myargs.masterList);
+	pthread_mutex_unlock(&myargs.masterList->listMutex);
+
+	pthread_barrier_wait(myargs.mapstop);
+
+	return 0;
+}
+
+void initGate(struct startGate *gate) {
+	pthread_mutex_init(&gate->gateMutex, NULL);
+	pthread_cond_init(&gate->gateCond, NULL);
+	gate->state = 0;
+}
+
+// Let everyone waiting through (state 1) or send them home (state -1)
+void openGate(struct startGate *gate, int state) {
+	pthread_mutex_lock(&gate->gateMutex);
+	gate->state = state;
+	pthread_cond_broadcast(&gate->gateCond);
+	pthread_mutex_unlock(&gate->gateMutex);
+}
+
+// Returns 1 if the thread should go on, 0 if it should exit right away
+int waitAtGate(struct startGate *gate) {
+	pthread_mutex_lock(&gate->gateMutex);
+	while (gate->state == 0) {
+		pthread_cond_wait(&gate->gateCond, &gate->gateMutex);
+	}
+	int go = (gate->state > 0);
+	pthread_mutex_unlock(&gate->gateMutex);
+
+	return go;
+}
+
+void destroyGate(struct startGate *gate) {
+	pthread_mutex_destroy(&gate->gateMutex);
+	pthread_cond_destroy(&gate->gateCond);
+}
+
+bool compareTickets(const struct ticket &a, const struct ticket &b) {
+	return a.cost > b.cost;
+}
+
+// Measures how much every letter has to write and fills writeQueue with tickets, biggest first.
+// Letters worth more than half a reducer's fair share are split into slices of about that size, since
+// otherwise the biggest letter alone would decide when reducing ends (and largest-first only balances
+// well when no single ticket is too big).
+// The vocabulary estimate isn't used here: by now the masterList is complete, so the per-letter costs are exact.
+void planTickets(struct wordList *masterList, struct writingQueue *writeQueue, int verbose) {
+	unsigned long letterCost[26] = {0};
+	unsigned long totalCost = 0;
+
+	for (auto &[word, files] : masterList->list) {
+		if (word.empty() || word[0] < 'a' || word[0] > 'z') {
+			continue;
+		}
+
+		unsigned long cost = entryCost(word, files);
+		letterCost[word[0] - 'a'] += cost;
+		totalCost += cost;
+	}
+
+	unsigned long slice = totalCost / writeQueue->nr_reducers / 2;
+
+	vector<struct ticket> tickets;
+	for (int i = 0; i < 26; i++) {
+		int parts = 1;
+		if (writeQueue->nr_reducers > 1 && slice > 0 && letterCost[i] > slice) {
+			parts = (letterCost[i] + slice - 1) / slice;
+		}
+
+		for (int part = 0; part < parts; part++) {
+			tickets.push_back({(char)('a' + i), part, parts, letterCost[i] / parts});
+		}
+
+		if (verbose > 1) {
+			printf("Letter %c: %lu bytes, %d tickets\n", 'a' + i, letterCost[i], parts);
+		}
+	}
+
+	std::stable_sort(tickets.begin(), tickets.end(), &compareTickets);
+
+	for (auto &t : tickets) {
+		writeQueue->queue.push(t);
+	}
+}
+
+void *reducer(void *arg) {
+	struct args myargs = *(struct args *)arg;
+
+	if (!waitAtGate(myargs.gate)) {
+		return 0;
+	}
+
+	// Reducers wait until all mappers have finished.
+	pthread_barrier_wait(myargs.mapstop);
+
+	if (myargs.verbose) {
+		printf("Reducer %d started.\n", myargs.thread_id);
+	}
+
+	pthread_mutex_lock(&myargs.writeQueue->queueMutex);
+	if (!myargs.writeQueue->planned) {
+		// Mapping is over, so the checkpoint manifest can stop holding anything back
+		if (myargs.checkpoint != NULL && syncCheckpoint(myargs.checkpoint) < 0 && myargs.verbose) {
+			printf("Could not sync the checkpoint manifest.\n");
+		}
+
+		planTickets(myargs.masterList, myargs.writeQueue, myargs.verbose);
+		myargs.writeQueue->planned = 1;
+	}
+	pthread_mutex_unlock(&myargs.writeQueue->queueMutex);
+
+	// Storing to sort as I wish
+	vector<wordEntry> sortedWords;
+	sortedWords.reserve(myargs.masterList->list.size());
+
+	for (auto &[word, files] : myargs.masterList->list) {
+		sortedWords.push_back({word, files});
+	}
+
+	sortWordlists(sortedWords);
+
+	// Every letter's words, in order. The order is the same for all reducers, so slices line up between them.
+	vector<wordEntry *> letters[26];
+	bucketLetters(sortedWords, letters);
+
+	vector<wordEntry *> words;
+
+	while (1) {
+		// Take from the queue
+
+		pthread_mutex_lock(&myargs.writeQueue->queueMutex);
+
+		if (myargs.writeQueue->queue.empty()) {
+			pthread_mutex_unlock(&myargs.writeQueue->queueMutex);
+			break;
+		}
+
+		struct ticket current = myargs.writeQueue->queue.front();
+		myargs.writeQueue->queue.pop();
+
+		pthread_mutex_unlock(&myargs.writeQueue->queueMutex);
+
+		// Make due with current ticket
+
+		collectSlice(letters[current.letter - 'a'], current.part, current.parts, words);
+		if (myargs.sink->writeLetterPart(current.letter, current.part, current.parts, words) < 0) {
+			if (myargs.verbose) {
+				printf("Reducer %d could not write letter %c.\n", myargs.thread_id, current.letter);
+			}
+
+			pthread_mutex_lock(&myargs.writeQueue->queueMutex);
+			myargs.writeQueue->failed = 1;
+			pthread_mutex_unlock(&myargs.writeQueue->queueMutex);
+		}
+	}
+
+	return 0;
+}
+
+double elapsedNs(struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+void *emptyThread(void *arg) {
+	return arg;
+}
+
+// Maps (up to CALIBRATION_BYTES of) the costliest file and merges the result, then weighs that against
+// what a mapper costs on top of its actual mapping (starting the thread + merging its list).
+// Returns how many bytes a mapper needs for that overhead to stay around 10%.
+unsigned long calibrateMapperBytes(struct fileinfo *files, int nr_files, int verbose) {
+	int biggest = 0;
+	for (int i = 1; i < nr_files; i++) {
+		if (files[i].cost > files[biggest].cost) {
+			biggest = i;
+		}
+	}
+
+	struct timespec start;
+	struct wordList localList;
+	struct wordList masterList;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long bytes = mapFile(&files[biggest], &localList, CALIBRATION_BYTES, NULL);
+
+	double mapNs = elapsedNs(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	combineLists(&localList, &masterList);
+	double mergeNs = elapsedNs(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_t thread;
+	int spawned = 0;
+	for (int i = 0; i < 8; i++) {
+		if (pthread_create(&thread, NULL, &emptyThread, NULL) != 0) {
+			break;
+		}
+		pthread_join(thread, NULL);
+		spawned++;
+	}
+
+	// If threads can't be started right now, leave thread start cost out of it
+	double spawnNs = spawned > 0 ? elapsedNs(&start) / spawned : 0;
+
+	if (bytes == 0) {
+		return MIN_MAPPER_BYTES;
+	}
+
+	unsigned long minBytes = (unsigned long)((spawnNs + mergeNs) / (mapNs / bytes) * 10);
+
+	if (verbose) {
+		printf("Calibration: mapped %lu bytes in %.2f ms, merge %.2f ms, thread start %.1f us -> %lu bytes per mapper\n", bytes, mapNs / 1e6, mergeNs / 1e6, spawnNs / 1e3, minBytes);
+	}
+
+	return minBytes > 0 ? minBytes : 1;
+}
+
+// Picks the mapper and/or reducer count (whichever is AUTO_THREADS) from the core count and the file sizes
+// (their costs, really - files resumed from a checkpoint only count for what loading their words takes).
+// Mappers and reducers never run at the same time (the barrier keeps them apart), so both may use every core.
+void autotune(struct fileinfo *files, int nr_files, int *nr_mappers, int *nr_reducers, int calibrate, int verbose) {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores < 1) {
+		cores = 1;
+	}
+
+	// Size histogram, bucketed by powers of two
+	int histogram[64] = {0};
+	unsigned long totalBytes = 0;
+	unsigned long largest = 0;
+
+	for (int i = 0; i < nr_files; i++) {
+		unsigned long size = files[i].cost;
+		int bucket = 0;
+		while ((1UL << bucket) < size) {
+			bucket++;
+		}
+		histogram[bucket]++;
+
+		totalBytes += size;
+		if (size > largest) {
+			largest = size;
+		}
+	}
+
+	unsigned long minBytes = MIN_MAPPER_BYTES;
+	if (calibrate && nr_files > 0) {
+		minBytes = calibrateMapperBytes(files, nr_files, verbose);
+	}
+
+	// Files can't be split, so there's no point in more mappers than files, and past total/largest
+	// mappers the biggest file alone decides when mapping ends
+	long limit = cores;
+	if (limit > nr_files) {
+		limit = nr_files;
+	}
+	if (largest > 0 && (long)((totalBytes + largest - 1) / largest) < limit) {
+		limit = (totalBytes + largest - 1) / largest;
+	}
+	if ((long)(totalBytes / minBytes) < limit) {
+		limit = totalBytes / minBytes;
+	}
+
+	if (*nr_mappers == AUTO_THREADS) {
+		*nr_mappers = limit > 1 ? limit : 1;
+	}
+
+	// Reducer work grows with the vocabulary (and so with the input), and there's only 26 letters to hand out
+	if (*nr_reducers == AUTO_THREADS) {
+		long reducers = cores < 26 ? cores : 26;
+		if ((long)(totalBytes / minBytes) < reducers) {
+			reducers = totalBytes / minBytes;
+		}
+		*nr_reducers = reducers > 1 ? reducers : 1;
+	}
+
+	if (!verbose) {
+		return;
+	}
+
+	printf("Auto configuration: %d mappers, %d reducers (%ld cores, %d files, %lu bytes, largest file %lu bytes, at least %lu bytes per mapper)\n", *nr_mappers, *nr_reducers, cores, nr_files, totalBytes, largest, minBytes);
+	printf("File sizes:");
+	for (int i = 0; i < 64; i++) {
+		if (histogram[i] > 0) {
+			if (i < 10) {
+				printf(" <=%luB: %d;", 1UL << i, histogram[i]);
+			} else {
+				printf(" <=%luK: %d;", 1UL << (i - 10), histogram[i]);
+			}
+		}
+	}
+	printf("\n");
+}
+
+int compareCostDesc(const void *a, const void *b) {
+	const struct fileinfo A = *(struct fileinfo *)a;
+	const struct fileinfo B = *(struct fileinfo *)b;
+	return (B.cost - A.cost);
+}
+
+// Balances files by cost, not size, so resumed files don't leave their mapper idle while the others map
+// https://en.wikipedia.org/wiki/Greedy_number_partitioning -> https://en.wikipedia.org/wiki/Longest-processing-time-first_scheduling
+void greedyPartition(struct fileinfo *files, int fileCount, int N, struct fileinfo **subsets, int *subsetSums, int *subsetCounts) {
+	for (int i = 0; i < N; i++) {
+		subsetSums[i] = 0;
+		subsetCounts[i] = 0;
+	}
+
+	// Nothing to hand out (and files may well be NULL then)
+	if (fileCount == 0) {
+		return;
+	}
+
+	// Descending order
+	qsort(files, fileCount, sizeof(struct fileinfo), compareCostDesc);
+
+	for (int i = 0; i < fileCount; i++) {
+		int minSubset = 0;
+		for (int j = 1; j < N; j++) {
+			if (subsetSums[j] < subsetSums[minSubset]) {
+				minSubset = j;
+			}
+		}
+
+		subsets[minSubset][subsetCounts[minSubset]] = files[i];
+		subsetCounts[minSubset]++;
+		subsetSums[minSubset] += files[i].cost;
+	}
+}
+
+} // namespace mapreduce
@@ -0,0 +1,109 @@
+#ifndef MAPREDUCE_H
+#define MAPREDUCE_H
+
+#include <pthread.h>
+
+#include <ostream>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "indexbuilder.h"
+
+#define MAX_BUFFER 512 // How big can a line be anyway?
+
+#define MIN_MAPPER_BYTES (256 * 1024)	 // Default for how much input a mapper needs to be worth starting
+#define CALIBRATION_BYTES (1024 * 1024) // How much input the calibration pass maps
+
+// Internal to the library: everything here is only reachable through IndexBuilder (see indexbuilder.h)
+namespace mapreduce {
+
+struct fileinfo {
+	char fileName[MAX_BUFFER];
+	int id;
+	int size;
+	const char *data; // Contents, for inputs that live in memory (NULL means read fileName)
+	int cost;		  // What the file is worth to a mapper: its size, or just its words file's if it's resumed from a checkpoint
+};
+
+struct wordList {
+	pthread_mutex_t listMutex; // not used locally - only on masterList
+	std::unordered_map<std::string, std::vector<int>> list;
+};
+
+// A reducer's writing assignment: one letter, or one slice of a letter that has too many words for a single reducer
+struct ticket {
+	char letter;
+	int part;			// Which slice of the letter's words (in output order) this is
+	int parts;			// How many slices the letter was split into
+	unsigned long cost; // Roughly how many bytes the ticket writes
+};
+
+struct writingQueue {
+	pthread_mutex_t queueMutex;
+	int planned;	 // Tickets can only be made once the mappers are done, by whichever reducer gets here first
+	int nr_reducers; // Used to decide which letters get split
+	int failed;		 // Set when the sink couldn't take a ticket
+	std::queue<struct ticket> queue;
+};
+
+// Holds the threads back until all of them exist, so that a failed pthread_create can still be backed out of
+// (instead of leaving the started threads stuck at the barrier)
+struct startGate {
+	pthread_mutex_t gateMutex;
+	pthread_cond_t gateCond;
+	int state; // 0 while waiting, 1 once every thread is up, -1 if they should give up
+};
+
+struct args {
+	int thread_id;
+	pthread_barrier_t *mapstop;		 // Barrier that everyone syncs to
+	struct startGate *gate;			 // Passed before doing anything else
+	int nr_files;					 // Number of files a mapper will handle
+	int nr_bytes;					 // Total cost of the files the mapper has
+	struct fileinfo *files;			 // The files a mapper will process
+	struct wordList *masterList;	 // The list every mapper will write to and reducers will read from
+	struct writingQueue *writeQueue; // The list from where reducers get their writing assignments
+	IndexSink *sink;				 // Where reducers hand over their letters
+	struct hyperLogLog *sketch;		 // Sample of the mapper's files, filled in by its estimator
+	unsigned long sampledBytes;		 // How much of the mapper's files went into sketch
+	unsigned long expectedWords;	 // How many distinct words the mapper is expected to find
+	struct checkpoint *checkpoint;	 // Where finished files are saved to/loaded from (NULL if not checkpointing)
+	int verbose;					 // Whether threads report what they're doing
+};
+
+void printArgs(struct args myargs);
+unsigned long fsize(char *file);
+
+// Hot kernels - kept separate from the threads so bench.cpp can time them on their own
+void processString(std::string &input, std::string &output);
+int mapWord(struct wordList *localList, const std::string &word, int fileId);
+unsigned long mapFile(struct fileinfo *file, struct wordList *localList, unsigned long maxBytes, std::vector<std::string> *fileWords);
+void mergeLists(struct wordList *localList, struct wordList *masterList);
+int combineWord(struct wordList *localList, const std::string &word, int fileId);
+void combineLists(struct wordList *localList, struct wordList *masterList);
+bool compareWordlists(const wordEntry &a, const wordEntry &b);
+void sortWordlists(std::vector<wordEntry> &words);
+void writeWords(std::ostream &out, std::vector<wordEntry *> &words);
+void bucketLetters(std::vector<wordEntry> &sortedWords, std::vector<wordEntry *> letters[26]);
+void collectSlice(std::vector<wordEntry *> &letter, int part, int parts, std::vector<wordEntry *> &words);
+
+void initGate(struct startGate *gate);
+void openGate(struct startGate *gate, int state);
+int waitAtGate(struct startGate *gate);
+void destroyGate(struct startGate *gate);
+
+void planTickets(struct wordList *masterList, struct writingQueue *writeQueue, int verbose);
+
+void *estimator(void *arg);
+void *mapper(void *arg);
+void *reducer(void *arg);
+
+void autotune(struct fileinfo *files, int nr_files, int *nr_mappers, int *nr_reducers, int calibrate, int verbose);
+void greedyPartition(struct fileinfo *files, int fileCount, int N, struct fileinfo **subsets, int *subsetSums, int *subsetCounts);
+
+} // namespace mapreduce
+
+#endif